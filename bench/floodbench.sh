@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# HELLO flood against the UDP server, once without a job budget and once
+# with -b. Every HELLO comes from a fresh socket and its job is abandoned,
+# so without a budget the table grows until the TTL sweep catches up; with
+# one, RSS should stay flat and throughput steady from round to round.
+#
+# Usage: sh bench/floodbench.sh   (or: make floodbench)
+# Knobs: ROUNDS, HELLOS (per round), WINDOW, BUDGET, PORT
+
+cd "$(dirname "$0")/.." || exit 1
+
+ROUNDS=${ROUNDS:-8}
+HELLOS=${HELLOS:-20000}
+WINDOW=${WINDOW:-256}
+BUDGET=${BUDGET:-1000}
+PORT=${PORT:-5720}
+
+run() {
+    log=$(mktemp)
+
+    ./server "$@" 127.0.0.1:$PORT > "$log" 2>&1 &
+    srv=$!
+    sleep 0.3
+
+    echo "server $*"
+    ./flood -r "$ROUNDS" -n "$HELLOS" -w "$WINDOW" -P $srv 127.0.0.1:$PORT
+
+    kill -TERM $srv
+    wait $srv 2> /dev/null
+    grep -E '^(Issued|Evicted)' "$log"
+    rm -f "$log"
+}
+
+run
+run -b "$BUDGET"
@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Loss-injection run for idempotent HELLO handling. N client sessions go
+# through ./proxy with seeded loss and a delay that sometimes outlasts the
+# client's 2 s retry timer, once with HELLO replay off (-T 0) and once with
+# the default window. Prints failed sessions and jobs the server generated.
+#
+# Usage: sh bench/losstest.sh   (or: make losstest)
+# Knobs: N, SEED, UP, DOWN (proxy impairment specs), PORT
+
+cd "$(dirname "$0")/.." || exit 1
+
+N=${N:-40}
+SEED=${SEED:-42}
+UP=${UP:-loss=10}
+DOWN=${DOWN:-loss=5,delay=1800,jitter=700}
+PORT=${PORT:-5700}
+
+run() {
+    replay=$1
+    sport=$PORT
+    pport=$((PORT + 1))
+    log=$(mktemp)
+
+    ./server -T "$replay" 127.0.0.1:$sport > "$log" 2>&1 &
+    srv=$!
+    ./proxy -S "$SEED" -u "$UP" -d "$DOWN" \
+            127.0.0.1:$pport 127.0.0.1:$sport > /dev/null 2>&1 &
+    pxy=$!
+    sleep 0.3
+
+    out=$(mktemp)
+    pids=
+    i=0
+    while [ $i -lt "$N" ]; do
+        ./client 127.0.0.1:$pport > "$out.$i" 2>&1 &
+        pids="$pids $!"
+        i=$((i + 1))
+    done
+    for p in $pids; do wait "$p"; done
+
+    ok=$(cat "$out".* | grep -c '^OK')
+    kill -TERM $srv $pxy
+    wait $srv $pxy 2> /dev/null
+    work=$(grep '^Issued' "$log")
+
+    printf '%-12s failed %3d/%d   %s\n' "replay=${replay}s" \
+           $((N - ok)) "$N" "$work"
+    rm -f "$log" "$out" "$out".*
+}
+
+echo "seed $SEED, up '$UP', down '$DOWN'"
+run 0
+run 6
@@ -6,13 +6,18 @@
 #include <cstdint>
 #include <chrono>
 #include <thread>
+#include <functional>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
 #include "protocol.h"
+#include "shmring.h"
 #include <calcLib.h>
 
 #ifdef DEBUG
@@ -89,6 +94,85 @@ static ssize_t txRxWithRetry(int           sock,
     return -1;
 }
 
+//shared-memory transport
+
+struct ShmLink {
+    ShmRegion* region{};
+    ShmSlot*   slot{};
+    ~ShmLink() {                         /* hand the slot back on any return */
+        if (slot) slot->owner.store(0, std::memory_order_release);
+    }
+};
+
+static int shmAttach(std::string name, ShmLink& link)
+{
+    if (name.empty() || name[0] != '/') name.insert(0, "/");
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) { perror("shm_open"); return -1; }
+
+    /* Mapping past the end of the object would SIGBUS on first touch. */
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        st.st_size < static_cast<off_t>(sizeof(ShmRegion))) {
+        std::cerr << "ERROR: " << name << " is not a calc server region.\n";
+        close(fd);
+        return -1;
+    }
+    void* p = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap"); return -1; }
+
+    auto* r = static_cast<ShmRegion*>(p);
+    if (r->magic != SHM_MAGIC || r->size != sizeof(ShmRegion)) {
+        std::cerr << "ERROR: " << name << " is not a calc server region.\n";
+        munmap(p, sizeof(ShmRegion));
+        return -1;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < r->nslots && i < SHM_SLOTS; ++i) {
+        int32_t freeSlot = 0;
+        if (r->slot[i].owner.compare_exchange_strong(freeSlot, getpid())) {
+            ringDrain(r->slot[i].resp);        /* leftovers of a previous owner */
+            link.region = r;
+            link.slot   = &r->slot[i];
+            return 0;
+        }
+    }
+    std::cerr << "ERROR: no free shared-memory slot.\n";
+    return -1;
+}
+
+/* No loss on this path, so one request gets the full retry budget. */
+static ssize_t shmTxRx(ShmLink&      link,
+                       const void*   sndBuf,
+                       size_t        sndLen,
+                       void*         rcvBuf,
+                       size_t        rcvLen)
+{
+    ShmSlot& s = *link.slot;
+    if (!ringPush(s.req, sndBuf, sndLen)) return -1;
+    bellRing(link.region->reqBell);
+
+    auto deadline = std::chrono::steady_clock::now() + WAIT * MAX_TRIES;
+    for (;;) {
+        ssize_t got = ringPop(s.resp, rcvBuf, rcvLen);
+        if (got >= 0) return got;
+
+        auto left = deadline - std::chrono::steady_clock::now();
+        if (left <= std::chrono::nanoseconds::zero()) return -1;
+
+        auto    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+        timespec ts{};
+        ts.tv_sec  = ns.count() / 1000000000;
+        ts.tv_nsec = ns.count() % 1000000000;
+        bellWait(s.respBell, [&] { return !ringEmpty(s.resp); },
+                 SHM_SPIN, &ts);
+    }
+}
+
 //main
 
 int main(int argc, char* argv[])
@@ -96,18 +180,34 @@ int main(int argc, char* argv[])
     (void)addrToString;                /* mark helper as used */
 
     if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <host:port>\n";
+        std::cerr << "Usage: " << argv[0] << " <host:port | shm:name>\n";
         return 1;
     }
 
-    sockaddr_storage dest{}; socklen_t destLen{};
-    if (resolveDest(argv[1], dest, destLen) != 0) return 1;
-    std::cout << "Host " << argv[1] << ".\n";
+    std::string target{argv[1]};
+    std::function<ssize_t(const void*, size_t, void*, size_t)> txRx;
+    ShmLink link;
+    int     sock = -1;
+
+    if (target.compare(0, 4, "shm:") == 0) {
+        if (shmAttach(target.substr(4), link) != 0) return 1;
+        std::cout << "Shared memory " << target.substr(4) << ".\n";
+        txRx = [&](const void* s, size_t sl, void* r, size_t rl) {
+            return shmTxRx(link, s, sl, r, rl);
+        };
+    } else {
+        sockaddr_storage dest{}; socklen_t destLen{};
+        if (resolveDest(target, dest, destLen) != 0) return 1;
+        std::cout << "Host " << target << ".\n";
 
-    int sock = socket(dest.ss_family, SOCK_DGRAM, 0);
-    if (sock < 0) { perror("socket"); return 1; }
-    if (connect(sock, reinterpret_cast<sockaddr*>(&dest), destLen) != 0) {
-        perror("connect"); return 1;
+        sock = socket(dest.ss_family, SOCK_DGRAM, 0);
+        if (sock < 0) { perror("socket"); return 1; }
+        if (connect(sock, reinterpret_cast<sockaddr*>(&dest), destLen) != 0) {
+            perror("connect"); return 1;
+        }
+        txRx = [&](const void* s, size_t sl, void* r, size_t rl) {
+            return txRxWithRetry(sock, s, sl, r, rl);
+        };
     }
 
     calcMessage hello{};
@@ -118,9 +218,8 @@ int main(int argc, char* argv[])
     hello.minor_version = htons(SUPP_MIN_VER);
 
     std::aligned_storage_t<sizeof(calcProtocol), alignof(calcProtocol)> rxBuf;
-    ssize_t got = txRxWithRetry(sock,
-                                &hello, sizeof(hello),
-                                &rxBuf, sizeof(rxBuf));
+    ssize_t got = txRx(&hello, sizeof(hello),
+                       &rxBuf, sizeof(rxBuf));
     if (got < 0) {
         std::cerr << "ERROR: server did not answer within 6 s.\n";
         return 1;
@@ -191,9 +290,8 @@ int main(int argc, char* argv[])
     reply.flResult      = fRes;
 
     calcMessage verdict{};
-    got = txRxWithRetry(sock,
-                        &reply, sizeof(reply),
-                        &verdict, sizeof(verdict));
+    got = txRx(&reply, sizeof(reply),
+               &verdict, sizeof(verdict));
     if (got < 0) {
         std::cerr << "ERROR: server did not confirm within 6 s.\n";
         return 1;
@@ -0,0 +1,195 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+
+/*
+   HELLO flood for the UDP server. Every HELLO goes out from a fresh socket,
+   so each one is a new client to the server; the job it gets back is never
+   answered. Against a 127/8 server the sources are spread over 127.0.0.0/8
+   with explicit ports, so no source address repeats (a single address would
+   recycle its ephemeral ports and turn the flood into replays). Runs
+   <rounds> rounds of <n> HELLOs, at most <window> sockets in flight, and
+   prints per round the jobs handed out, the rate, and (with -P) the
+   server's resident set size.
+*/
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr auto     REPLY_WAIT   = std::chrono::milliseconds{200};
+static constexpr uint32_t PORT_BASE    = 10000;  /* explicit source ports */
+static constexpr uint32_t PORTS        = 50000;
+
+//helpers
+
+static int resolve(const std::string& hp, sockaddr_storage& out, socklen_t& len)
+{
+    auto colon = hp.rfind(':');
+    if (colon == std::string::npos) return -1;
+
+    std::string host = hp.substr(0, colon);
+    std::string port = hp.substr(colon + 1);
+
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (rv) {
+        std::cerr << "getaddrinfo: " << gai_strerror(rv) << '\n';
+        return -1;
+    }
+    memcpy(&out, res->ai_addr, res->ai_addrlen);
+    len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* VmRSS of <pid> in kB, or -1. */
+static long rssKb(pid_t pid)
+{
+    std::ifstream f("/proc/" + std::to_string(pid) + "/status");
+    for (std::string line; std::getline(f, line); )
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::atol(line.c_str() + 6);
+    return -1;
+}
+
+static bool isLoopback4(const sockaddr_storage& s)
+{
+    if (s.ss_family != AF_INET) return false;
+    auto a = ntohl(reinterpret_cast<const sockaddr_in&>(s).sin_addr.s_addr);
+    return (a >> 24) == 127;
+}
+
+/* Source of the <seq>th socket: each port once per address, 127.0.0.1 up. */
+static sockaddr_in sourceFor(uint64_t seq)
+{
+    sockaddr_in a{};
+    a.sin_family      = AF_INET;
+    a.sin_port        = htons(PORT_BASE + seq % PORTS);
+    a.sin_addr.s_addr = htonl(0x7f000001u + (seq / PORTS) % 0xfffffe);
+    return a;
+}
+
+/* One window: <k> fresh sockets send a HELLO each; returns jobs received. */
+static int floodWindow(const sockaddr_storage& server, socklen_t serverLen,
+                       int k, std::vector<pollfd>& fds, uint64_t& seq)
+{
+    calcMessage hello{};
+    hello.type          = htons(22);
+    hello.message       = htonl(0);
+    hello.protocol      = htons(17);
+    hello.major_version = htons(1);
+    hello.minor_version = htons(0);
+
+    fds.clear();
+    for (int i = 0; i < k; ++i) {
+        int fd = socket(server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) { perror("socket"); break; }
+        if (isLoopback4(server)) {
+            sockaddr_in src = sourceFor(seq++);
+            if (bind(fd, reinterpret_cast<sockaddr*>(&src), sizeof(src))) {
+                close(fd);
+                continue;
+            }
+        }
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&server),
+                    serverLen) != 0 ||
+            send(fd, &hello, sizeof(hello), 0) != sizeof(hello)) {
+            close(fd);
+            continue;
+        }
+        fds.push_back({fd, POLLIN, 0});
+    }
+
+    int  jobs    = 0;
+    int  waiting = static_cast<int>(fds.size());
+    auto until   = Clock::now() + REPLY_WAIT;
+    while (waiting > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        until - Clock::now()).count();
+        if (left <= 0 || poll(fds.data(), fds.size(), left) <= 0) break;
+
+        for (auto& p : fds) {
+            if (p.fd < 0 || !(p.revents & POLLIN)) continue;
+            calcProtocol job;
+            if (recv(p.fd, &job, sizeof(job), 0) == sizeof(job)) ++jobs;
+            close(p.fd);
+            p.fd = -1;                      /* poll() skips negative fds */
+            --waiting;
+        }
+    }
+    for (auto& p : fds)
+        if (p.fd >= 0) close(p.fd);
+    return jobs;
+}
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog
+              << " [-r rounds] [-n hellos] [-w window] [-P server-pid]"
+                 " <server-host:port>\n";
+}
+
+int main(int argc, char* argv[])
+{
+    int   rounds = 8, hellos = 20000, window = 256;
+    pid_t pid    = 0;
+
+    for (int opt; (opt = getopt(argc, argv, "r:n:w:P:")) != -1; ) {
+        switch (opt) {
+            case 'r': rounds = std::atoi(optarg); break;
+            case 'n': hellos = std::atoi(optarg); break;
+            case 'w': window = std::atoi(optarg); break;
+            case 'P': pid    = std::atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 1 || rounds <= 0 || hellos <= 0 || window <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sockaddr_storage server{};
+    socklen_t        serverLen{};
+    if (resolve(argv[optind], server, serverLen) != 0) {
+        std::cerr << "Invalid address format.\n";
+        return 1;
+    }
+
+    std::vector<pollfd> fds;
+    fds.reserve(window);
+    uint64_t seq = 0;
+
+    for (int r = 0; r < rounds; ++r) {
+        auto start = Clock::now();
+        int  jobs  = 0;
+        for (int sent = 0; sent < hellos; sent += window)
+            jobs += floodWindow(server, serverLen,
+                                std::min(window, hellos - sent), fds, seq);
+        double s = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << "round " << std::setw(2) << r
+                  << "  jobs " << std::setw(6) << jobs << '/' << hellos
+                  << "  " << std::setw(7) << static_cast<long>(jobs / s)
+                  << " jobs/s";
+        if (pid > 0) std::cout << "  rss " << std::setw(7) << rssKb(pid) << " kB";
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,500 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#ifdef DEBUG
+#define DBG(x) do { x; } while (0)
+#else
+#define DBG(x) do {} while (0)
+#endif
+
+/*
+   UDP impairment proxy. Clients talk to <listen>, the proxy relays to
+   <server> through one upstream socket per client (so the server still
+   sees distinct source addresses) and applies loss, latency, jitter,
+   duplication and reordering independently per direction. Randomness is
+   seeded per direction, so the same traffic replays the same impairments.
+
+   Packets live in a fixed pool ordered by due time in a heap; I/O is
+   batched with recvmmsg/sendmmsg and nothing is allocated per packet.
+*/
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int      BATCH     = 32;
+static constexpr uint32_t POOL      = 16384;
+static constexpr uint32_t MAX_FLOWS = 4096;
+static constexpr size_t   MAX_DGRAM = 512;
+static constexpr auto     FLOW_IDLE = std::chrono::seconds{30};
+
+static constexpr uint32_t EV_LISTEN = UINT32_MAX;
+static constexpr uint32_t EV_TIMER  = UINT32_MAX - 1;
+
+enum { UP = 0, DOWN = 1 };   /* client -> server, server -> client */
+
+struct Impair {
+    double loss{}, dup{}, reorder{};        /* probabilities, 0..1 */
+    double delayMs{}, jitterMs{}, gapMs{5};
+};
+
+struct Stats {
+    uint64_t rx{}, lost{}, duped{}, reordered{}, tx{}, overflow{};
+};
+
+struct Dir {
+    Impair                                 imp;
+    std::mt19937_64                        rng;
+    std::uniform_real_distribution<double> u{0.0, 1.0};
+    Stats                                  st;
+};
+
+struct Packet {
+    Clock::time_point due;
+    uint64_t          seq;                  /* FIFO among equal due times */
+    uint32_t          flow;
+    uint16_t          len;
+    uint8_t           dir;
+    unsigned char     data[MAX_DGRAM];
+};
+
+struct Flow {
+    sockaddr_storage  peer{};
+    socklen_t         len{};
+    int               fd = -1;
+    Clock::time_point lastSeen{};
+};
+
+struct AddrKey {
+    sockaddr_storage s{};
+    socklen_t        len{};
+    bool operator==(const AddrKey& o) const {
+        return len == o.len && std::memcmp(&s, &o.s, len) == 0;
+    }
+};
+struct AddrKeyHash {
+    std::size_t operator()(const AddrKey& k) const noexcept
+    {
+        const std::uint64_t* p =
+            reinterpret_cast<const std::uint64_t*>(&k.s);
+        std::size_t h = 0;
+        for (std::size_t i = 0; i < sizeof(k.s) / sizeof(std::uint64_t); ++i)
+            h ^= p[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+static volatile sig_atomic_t stopReq = 0;
+static void onSignal(int) { stopReq = 1; }
+
+//helpers
+
+static int resolve(const std::string& hp, int flags,
+                   sockaddr_storage& out, socklen_t& len)
+{
+    auto colon = hp.rfind(':');
+    if (colon == std::string::npos) return -1;
+
+    std::string host = hp.substr(0, colon);
+    std::string port = hp.substr(colon + 1);
+
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags    = flags;
+
+    int rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (rv) {
+        std::cerr << "getaddrinfo: " << gai_strerror(rv) << '\n';
+        return -1;
+    }
+    memcpy(&out, res->ai_addr, res->ai_addrlen);
+    len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* "loss=5,delay=20,jitter=5,dup=1,reorder=2,gap=5", percentages and ms */
+static int parseImpair(const std::string& spec, Impair& imp)
+{
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string kv = spec.substr(pos, end - pos);
+        pos = end + 1;
+
+        auto eq = kv.find('=');
+        if (eq == std::string::npos) return -1;
+        std::string k = kv.substr(0, eq);
+        double      v = std::atof(kv.c_str() + eq + 1);
+        if (v < 0) return -1;
+
+        if      (k == "loss")    imp.loss     = v / 100.0;
+        else if (k == "dup")     imp.dup      = v / 100.0;
+        else if (k == "reorder") imp.reorder  = v / 100.0;
+        else if (k == "delay")   imp.delayMs  = v;
+        else if (k == "jitter")  imp.jitterMs = v;
+        else if (k == "gap")     imp.gapMs    = v;
+        else return -1;
+    }
+    return 0;
+}
+
+static void printStats(const char* name, const Stats& s)
+{
+    std::cerr << std::left << std::setw(6) << name << std::right
+              << " rx "        << std::setw(10) << s.rx
+              << " lost "      << std::setw(8)  << s.lost
+              << " dup "       << std::setw(8)  << s.duped
+              << " reordered " << std::setw(8)  << s.reordered
+              << " tx "        << std::setw(10) << s.tx
+              << " overflow "  << std::setw(8)  << s.overflow << '\n';
+}
+
+//proxy state
+
+static std::vector<Packet>   pool(POOL);
+static std::vector<uint32_t> freeList;
+static std::vector<uint32_t> heap;          /* pool indices, earliest due on top */
+static uint64_t              nextSeq = 0;
+
+static bool laterDue(uint32_t a, uint32_t b)
+{
+    if (pool[a].due != pool[b].due) return pool[a].due > pool[b].due;
+    return pool[a].seq > pool[b].seq;
+}
+
+static std::vector<Flow>                             flows;
+static std::unordered_map<AddrKey, uint32_t, AddrKeyHash> flowIdx;
+
+/* Roll the dice for one datagram and queue zero, one or two copies. */
+static void admit(Dir& d, uint8_t dir, uint32_t flow,
+                  const void* buf, size_t len, Clock::time_point now)
+{
+    ++d.st.rx;
+    if (d.u(d.rng) < d.imp.loss) { ++d.st.lost; return; }
+
+    int copies = 1;
+    if (d.u(d.rng) < d.imp.dup) { ++d.st.duped; copies = 2; }
+
+    for (int c = 0; c < copies; ++c) {
+        if (freeList.empty()) { ++d.st.overflow; return; }
+
+        double ms = d.imp.delayMs + d.imp.jitterMs * (2.0 * d.u(d.rng) - 1.0);
+        if (d.u(d.rng) < d.imp.reorder) {
+            ms += d.imp.gapMs;              /* held back, later ones overtake */
+            ++d.st.reordered;
+        }
+        if (ms < 0) ms = 0;
+
+        uint32_t i = freeList.back();
+        freeList.pop_back();
+        Packet& p = pool[i];
+        p.due  = now + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double, std::milli>(ms));
+        p.seq  = nextSeq++;
+        p.flow = flow;
+        p.len  = static_cast<uint16_t>(len);
+        p.dir  = dir;
+        std::memcpy(p.data, buf, len);
+
+        heap.push_back(i);
+        std::push_heap(heap.begin(), heap.end(), laterDue);
+    }
+}
+
+static int flowFor(const sockaddr_storage& from, socklen_t fromLen,
+                   const sockaddr_storage& server, socklen_t serverLen,
+                   int ep, Clock::time_point now)
+{
+    AddrKey k{from, fromLen};
+    if (auto it = flowIdx.find(k); it != flowIdx.end()) {
+        flows[it->second].lastSeen = now;
+        return static_cast<int>(it->second);
+    }
+
+    uint32_t slot = static_cast<uint32_t>(flows.size());
+    if (flows.size() == MAX_FLOWS) {        /* recycle the stalest idle flow */
+        slot = MAX_FLOWS;
+        for (uint32_t i = 0; i < flows.size(); ++i)
+            if (now - flows[i].lastSeen > FLOW_IDLE &&
+                (slot == MAX_FLOWS ||
+                 flows[i].lastSeen < flows[slot].lastSeen))
+                slot = i;
+        if (slot == MAX_FLOWS) return -1;
+        flowIdx.erase(AddrKey{flows[slot].peer, flows[slot].len});
+        close(flows[slot].fd);
+    } else {
+        flows.emplace_back();
+    }
+
+    int fd = socket(server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 ||
+        connect(fd, reinterpret_cast<const sockaddr*>(&server), serverLen)) {
+        perror("upstream socket");
+        if (fd >= 0) close(fd);
+        flows[slot].fd = -1;
+        flows[slot].lastSeen = Clock::time_point{};   /* reusable right away */
+        return -1;
+    }
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u32 = slot;
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+
+    Flow& f    = flows[slot];
+    f.peer     = from;
+    f.len      = fromLen;
+    f.fd       = fd;
+    f.lastSeen = now;
+    flowIdx.emplace(k, slot);
+    DBG(std::cerr << "New flow " << slot << '\n');
+    return static_cast<int>(slot);
+}
+
+//main
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog
+              << " [-S seed] [-u spec] [-d spec] <listen-host:port>"
+                 " <server-host:port>\n"
+                 "  spec: loss=%,dup=%,reorder=%,delay=ms,jitter=ms,gap=ms\n"
+                 "  -u client->server, -d server->client\n";
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t seed = 1;
+    Dir      dir[2];
+
+    for (int opt; (opt = getopt(argc, argv, "S:u:d:")) != -1; ) {
+        switch (opt) {
+            case 'S': seed = std::strtoull(optarg, nullptr, 0); break;
+            case 'u':
+            case 'd':
+                if (parseImpair(optarg, dir[opt == 'u' ? UP : DOWN].imp)) {
+                    std::cerr << "Bad impairment spec '" << optarg << "'.\n";
+                    return 1;
+                }
+                break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    dir[UP].rng.seed(seed);
+    dir[DOWN].rng.seed(seed ^ 0x9e3779b97f4a7c15ULL);
+
+    sockaddr_storage listenAddr{}, server{};
+    socklen_t        listenLen{}, serverLen{};
+    if (resolve(argv[optind], AI_PASSIVE, listenAddr, listenLen) != 0 ||
+        resolve(argv[optind + 1], 0, server, serverLen) != 0) {
+        std::cerr << "Invalid address format.\n";
+        return 1;
+    }
+
+    int ls = socket(listenAddr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (ls < 0) { perror("socket"); return 1; }
+    if (bind(ls, reinterpret_cast<sockaddr*>(&listenAddr), listenLen) != 0) {
+        perror("bind");
+        return 1;
+    }
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    int ep  = epoll_create1(0);
+    if (tfd < 0 || ep < 0) { perror("epoll/timerfd"); return 1; }
+
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u32 = EV_LISTEN;
+    epoll_ctl(ep, EPOLL_CTL_ADD, ls, &ev);
+    ev.data.u32 = EV_TIMER;
+    epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev);
+
+    freeList.reserve(POOL);
+    for (uint32_t i = POOL; i > 0; --i) freeList.push_back(i - 1);
+    heap.reserve(POOL);
+    flows.reserve(MAX_FLOWS);
+    flowIdx.reserve(MAX_FLOWS);
+
+    struct sigaction sa{};
+    sa.sa_handler = onSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::cout << "Proxy " << argv[optind] << " -> " << argv[optind + 1]
+              << " (seed " << seed << ")\n";
+
+    /* batch buffers, reused for every recvmmsg/sendmmsg */
+    static unsigned char    rxData[BATCH][MAX_DGRAM];
+    static sockaddr_storage rxFrom[BATCH];
+    static iovec            rxIov[BATCH], txIov[BATCH], upIov[BATCH];
+    static mmsghdr          rxMsg[BATCH], txMsg[BATCH], upMsg[BATCH];
+    uint32_t                txIdx[BATCH], upIdx[BATCH];
+
+    for (int i = 0; i < BATCH; ++i) {
+        rxIov[i] = {rxData[i], MAX_DGRAM};
+        rxMsg[i].msg_hdr.msg_iov    = &rxIov[i];
+        rxMsg[i].msg_hdr.msg_iovlen = 1;
+        txMsg[i].msg_hdr.msg_iov    = &txIov[i];
+        txMsg[i].msg_hdr.msg_iovlen = 1;
+        upMsg[i].msg_hdr.msg_iov    = &upIov[i];
+        upMsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto sendDown = [&](int n) {
+        int done = 0;
+        while (done < n) {
+            int rv = sendmmsg(ls, txMsg + done, n - done, 0);
+            if (rv <= 0) { DBG(perror("sendmmsg")); break; }
+            done += rv;
+        }
+        dir[DOWN].st.tx += done;
+        for (int i = 0; i < n; ++i) freeList.push_back(txIdx[i]);
+    };
+
+    /*
+       Upstream sockets are per flow, so one sendmmsg covers one flow's run.
+       Group the batch by flow first; insertion sort is stable, keeps due
+       order within a flow and needs no scratch memory for BATCH entries.
+    */
+    auto sendUp = [&](int n) {
+        for (int i = 1; i < n; ++i)
+            for (int j = i;
+                 j > 0 && pool[upIdx[j - 1]].flow > pool[upIdx[j]].flow; --j)
+                std::swap(upIdx[j - 1], upIdx[j]);
+        for (int i = 0; i < n; ++i)
+            upIov[i] = {pool[upIdx[i]].data, pool[upIdx[i]].len};
+
+        for (int i = 0; i < n; ) {
+            uint32_t f = pool[upIdx[i]].flow;
+            int      j = i;
+            while (j < n && pool[upIdx[j]].flow == f) ++j;
+
+            int done = 0;
+            while (flows[f].fd >= 0 && done < j - i) {
+                int rv = sendmmsg(flows[f].fd, upMsg + i + done,
+                                  j - i - done, 0);
+                if (rv <= 0) { DBG(perror("sendmmsg")); break; }
+                done += rv;
+            }
+            dir[UP].st.tx += done;
+            i = j;
+        }
+        for (int i = 0; i < n; ++i) freeList.push_back(upIdx[i]);
+    };
+
+    epoll_event evs[64];
+    while (!stopReq) {
+        int n = epoll_wait(ep, evs, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        auto now = Clock::now();
+
+        for (int e = 0; e < n; ++e) {
+            uint32_t tag = evs[e].data.u32;
+
+            if (tag == EV_TIMER) {
+                uint64_t ticks;
+                while (read(tfd, &ticks, sizeof(ticks)) > 0) {}
+                continue;
+            }
+
+            bool fromClient = tag == EV_LISTEN;
+            int  fd         = fromClient ? ls : flows[tag].fd;
+            for (;;) {
+                for (int i = 0; i < BATCH; ++i) {
+                    rxMsg[i].msg_hdr.msg_name    = fromClient ? &rxFrom[i]
+                                                              : nullptr;
+                    rxMsg[i].msg_hdr.msg_namelen = fromClient ? sizeof(rxFrom[i])
+                                                              : 0;
+                }
+                int got = recvmmsg(fd, rxMsg, BATCH, MSG_DONTWAIT, nullptr);
+                if (got <= 0) break;
+
+                for (int i = 0; i < got; ++i) {
+                    if (rxMsg[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                        ++dir[fromClient ? UP : DOWN].st.overflow;
+                        continue;                   /* bigger than MAX_DGRAM */
+                    }
+                    if (fromClient) {
+                        int f = flowFor(rxFrom[i], rxMsg[i].msg_hdr.msg_namelen,
+                                        server, serverLen, ep, now);
+                        if (f < 0) { ++dir[UP].st.overflow; continue; }
+                        admit(dir[UP], UP, f, rxData[i], rxMsg[i].msg_len, now);
+                    } else {
+                        flows[tag].lastSeen = now;
+                        admit(dir[DOWN], DOWN, tag, rxData[i],
+                              rxMsg[i].msg_len, now);
+                    }
+                }
+                if (got < BATCH) break;
+            }
+        }
+
+        /* release everything that is due */
+
+        now = Clock::now();
+        int txN = 0, upN = 0;
+        while (!heap.empty() && pool[heap.front()].due <= now) {
+            std::pop_heap(heap.begin(), heap.end(), laterDue);
+            uint32_t i = heap.back();
+            heap.pop_back();
+            Packet& p = pool[i];
+
+            if (p.dir == UP) {
+                upIdx[upN++] = i;
+                if (upN == BATCH) { sendUp(upN); upN = 0; }
+                continue;
+            }
+
+            Flow& f = flows[p.flow];
+            txIov[txN]                    = {p.data, p.len};
+            txMsg[txN].msg_hdr.msg_name    = &f.peer;
+            txMsg[txN].msg_hdr.msg_namelen = f.len;
+            txIdx[txN++]                  = i;
+            if (txN == BATCH) { sendDown(txN); txN = 0; }
+        }
+        if (txN) sendDown(txN);
+        if (upN) sendUp(upN);
+
+        itimerspec its{};
+        if (!heap.empty()) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          pool[heap.front()].due.time_since_epoch()).count();
+            its.it_value.tv_sec  = ns / 1000000000;
+            its.it_value.tv_nsec = ns % 1000000000;
+        }
+        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+    }
+
+    printStats("up", dir[UP].st);
+    printStats("down", dir[DOWN].st);
+    return 0;
+}
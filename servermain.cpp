@@ -4,16 +4,29 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <unordered_map>
 #include <chrono>
 #include <cmath>
+#include <new>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/filter.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
 #include "protocol.h"
+#include "shmring.h"
 #include <calcLib.h>
 
 #ifdef DEBUG
@@ -22,9 +35,60 @@
 #define DBG(x) do {} while (0)
 #endif
 
-static constexpr uint8_t SUPP_MAJ_VER = 1;
-static constexpr uint8_t SUPP_MIN_VER = 0;
-static constexpr int     JOB_TTL_S    = 10;
+/*
+   Static tracepoints (provider "calcserver"), usable from perf and
+   bpftrace when <sys/sdt.h> is available; a disabled probe is a nop.
+*/
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE(name, ...) STAP_PROBEV(calcserver, name, ##__VA_ARGS__)
+#else
+#define PROBE(name, ...) do {} while (0)
+#endif
+
+/*
+   serverP build (-DPHASES): per-phase cycle counts for the UDP loop.
+   PHASE(p) charges everything since the previous mark to phase p.
+*/
+#ifdef PHASES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+#else
+static inline uint64_t cycles()
+{
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+#endif
+
+enum Phase { PH_RECV, PH_LOG, PH_CLASSIFY, PH_GENERATE, PH_TABLE,
+             PH_VERIFY, PH_SEND, PH_SWEEP, PH_COUNT };
+static const char* const phaseName[PH_COUNT] = {
+    "recv", "log", "classify", "generate", "table", "verify", "send",
+    "sweep" };
+static uint64_t phaseCycles[PH_COUNT], phaseHits[PH_COUNT], phaseMark;
+
+#define PHASE_BEGIN() do { phaseMark = cycles(); } while (0)
+#define PHASE(p) do {                              \
+        uint64_t t_ = cycles();                    \
+        phaseCycles[p] += t_ - phaseMark;          \
+        ++phaseHits[p];                            \
+        phaseMark = t_;                            \
+    } while (0)
+#else
+#define PHASE_BEGIN() do {} while (0)
+#define PHASE(p)      do {} while (0)
+#endif
+
+#define MARK(p, name, ...) do { PROBE(name, ##__VA_ARGS__); PHASE(p); } while (0)
+
+static constexpr uint8_t SUPP_MAJ_VER   = 1;
+static constexpr uint8_t SUPP_MIN_VER   = 0;
+static constexpr int     JOB_TTL_S      = 10;
+static constexpr int     HELLO_REPLAY_S = 6;   /* client MAX_TRIES * WAIT */
+static constexpr int     SWEEP_S        = 1;
+static constexpr long    MAX_JOBS       = 1L << 24;  /* -b ceiling; its ring is ~1.2 GB */
+static constexpr long    MAX_SHARDS     = 256;       /* -R ceiling */
 
 //map and key type
 struct AddrKey {
@@ -56,6 +120,12 @@ struct Job {
 
 using JobMap = std::unordered_map<AddrKey, Job, AddrKeyHash>;
 
+using RxBuf = std::aligned_storage_t<
+    (sizeof(calcProtocol) > sizeof(calcMessage)
+         ? sizeof(calcProtocol)
+         : sizeof(calcMessage)),
+    alignof(calcProtocol)>;
+
 
 static std::string addrToString(const sockaddr_storage& s, socklen_t len)
 {
@@ -66,22 +136,858 @@ static std::string addrToString(const sockaddr_storage& s, socklen_t len)
     return std::string(hbuf) + ":" + pbuf;
 }
 
-//main
+//protocol helpers, shared by every transport
 
-int main(int argc, char* argv[])
+static bool helloOK(const calcMessage& cm)
 {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <bind-host:port>\n";
-        return 1;
+    return ntohs(cm.type) == 22 &&
+           ntohl(cm.message) == 0 &&
+           ntohs(cm.major_version) == SUPP_MAJ_VER &&
+           ntohs(cm.minor_version) == SUPP_MIN_VER;
+}
+
+/* also used as the reject for a bad HELLO */
+static calcMessage makeVerdict(bool ok)
+{
+    calcMessage v{};
+    v.type          = htons(2);
+    v.message       = htonl(ok ? 1 : 2);
+    v.protocol      = htons(17);
+    v.major_version = htons(SUPP_MAJ_VER);
+    v.minor_version = htons(SUPP_MIN_VER);
+    return v;
+}
+
+static Job makeJob(uint32_t id)
+{
+    char* op = randomType();
+    bool  fp = (op[0] == 'f');
+
+    Job job;
+    job.id    = id;
+    job.arith = fp
+                ? (strcmp(op, "fadd") == 0 ? 5
+                   : strcmp(op, "fsub") == 0 ? 6
+                   : strcmp(op, "fmul") == 0 ? 7
+                                             : 8)
+                : (strcmp(op, "add") == 0 ? 1
+                   : strcmp(op, "sub") == 0 ? 2
+                   : strcmp(op, "mul") == 0 ? 3
+                                            : 4);
+
+    if (fp) {
+        job.fa = randomFloat();
+        do job.fb = randomFloat();
+        while (job.arith == 8 && job.fb == 0.0);  /* randomFloat() may be 0 */
+        switch (job.arith) {
+            case 5: job.fres = job.fa + job.fb; break;
+            case 6: job.fres = job.fa - job.fb; break;
+            case 7: job.fres = job.fa * job.fb; break;
+            case 8: job.fres = job.fa / job.fb; break;
+        }
+    } else {
+        job.ia = randomInt();
+        do job.ib = randomInt();
+        while (job.arith == 4 && job.ib == 0);    /* randomInt() may be 0 */
+        switch (job.arith) {
+            case 1: job.ires = job.ia + job.ib; break;
+            case 2: job.ires = job.ia - job.ib; break;
+            case 3: job.ires = job.ia * job.ib; break;
+            case 4: job.ires = job.ia / job.ib; break;
+        }
+    }
+    job.deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(JOB_TTL_S);
+    return job;
+}
+
+static calcProtocol encodeJob(const Job& job)
+{
+    calcProtocol tp{};
+    tp.type          = htons(1);
+    tp.major_version = htons(SUPP_MAJ_VER);
+    tp.minor_version = htons(SUPP_MIN_VER);
+    tp.id            = htonl(job.id);
+    tp.arith         = htonl(job.arith);
+    tp.inValue1      = htonl(job.ia);
+    tp.inValue2      = htonl(job.ib);
+    tp.flValue1      = job.fa;
+    tp.flValue2      = job.fb;
+    return tp;
+}
+
+static bool checkResult(const Job& job, const calcProtocol& cp)
+{
+    if (job.arith <= 4)
+        return static_cast<uint32_t>(job.ires) == ntohl(cp.inResult);
+    double diff = std::fabs(job.fres - cp.flResult);
+    return diff < 1e-4;
+}
+
+//job budget
+
+/*
+   Hard cap on outstanding UDP jobs (-b). Each new job is also logged in a
+   fixed ring in issue order; with one TTL for every job that is deadline
+   order, so when the table goes over budget the oldest live job is
+   evicted. Ring entries of jobs that were answered, expired or replaced
+   no longer match the table by id and are just skipped; when the ring
+   fills up they are compacted away in place, never a live job. The ring
+   holds 2 * limit entries and the map is reserved up front, so a flood
+   costs no rehashing and no memory growth beyond the budget.
+*/
+struct AgedKey {
+    uint8_t  addr[sizeof(sockaddr_in6)];
+    uint32_t len;
+    uint32_t id;
+};
+
+struct JobBudget {
+    size_t               limit = 0;          /* 0 = unbounded */
+    std::vector<AgedKey> ring;
+    size_t               head  = 0, count = 0;
+    uint64_t             evictions = 0;
+};
+
+static void budgetInit(JobBudget& b, size_t limit, JobMap& jobs)
+{
+    b.limit = limit;
+    b.ring.resize(2 * limit);
+    jobs.reserve(limit + 1);
+}
+
+/* The table entry <a> still stands for, or jobs.end() if it is stale. */
+static JobMap::iterator budgetLive(const AgedKey& a, JobMap& jobs)
+{
+    AddrKey k;
+    std::memcpy(&k.s, a.addr, a.len);
+    k.len = a.len;
+    auto it = jobs.find(k);
+    return it != jobs.end() && it->second.id == a.id ? it : jobs.end();
+}
+
+static void budgetPop(JobBudget& b, JobMap& jobs)
+{
+    const AgedKey& a = b.ring[b.head];
+    b.head = (b.head + 1) % b.ring.size();
+    --b.count;
+
+    auto it = budgetLive(a, jobs);
+    if (it != jobs.end()) {
+        DBG(std::cerr << "Evicting job " << a.id << " of "
+                      << addrToString(it->first.s, it->first.len) << '\n');
+        PROBE(evict, a.id);
+        jobs.erase(it);
+        ++b.evictions;
+    }
+}
+
+/*
+   Drop stale entries, keeping the live ones in issue order. At most one
+   entry per table job is live and the table is at most <limit> jobs, so
+   this always frees at least half of the 2 * limit ring.
+*/
+static void budgetCompact(JobBudget& b, JobMap& jobs)
+{
+    size_t n = b.ring.size(), kept = 0;
+    for (size_t i = 0; i < b.count; ++i) {
+        const AgedKey& a = b.ring[(b.head + i) % n];
+        if (budgetLive(a, jobs) == jobs.end()) continue;
+        if (kept != i) b.ring[(b.head + kept) % n] = a;
+        ++kept;
+    }
+    b.count = kept;
+}
+
+/* Call after <k> got job <id>; trims the table back to the budget. */
+static void budgetAdmit(JobBudget& b, JobMap& jobs, const AddrKey& k,
+                        uint32_t id)
+{
+    if (b.limit == 0 || k.len > sizeof(AgedKey::addr)) return;
+    if (b.count == b.ring.size()) budgetCompact(b, jobs);
+    if (b.count == b.ring.size()) budgetPop(b, jobs);   /* cannot happen */
+
+    AgedKey& a = b.ring[(b.head + b.count++) % b.ring.size()];
+    std::memcpy(a.addr, &k.s, k.len);
+    a.len = k.len;
+    a.id  = id;
+
+    while (jobs.size() > b.limit && b.count > 0) budgetPop(b, jobs);
+}
+
+//shared-memory transport
+
+static ShmRegion* createShm(const std::string& name)
+{
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) { perror("shm_open"); return nullptr; }
+    if (ftruncate(fd, sizeof(ShmRegion)) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap"); return nullptr; }
+
+    auto* r   = new (p) ShmRegion{};
+    r->size   = sizeof(ShmRegion);
+    r->nslots = SHM_SLOTS;
+    std::atomic_thread_fence(std::memory_order_release);
+    r->magic  = SHM_MAGIC;              /* clients check this last */
+    return r;
+}
+
+static void shmReply(ShmSlot& s, const void* msg, size_t len)
+{
+    if (!ringPush(s.resp, msg, len))
+        DBG(std::cerr << "shm response ring full, dropping reply.\n");
+    bellRing(s.respBell);
+}
+
+/*
+   Runs on its own thread. Each slot is one client, so the job table is a
+   plain array indexed by slot rather than a JobMap. The region is writable
+   by every client, so sizes come from SHM_SLOTS, never from r->nslots.
+*/
+static void serveShm(ShmRegion* r, int spins, std::atomic<uint32_t>& nextId)
+{
+    std::vector<Job> slotJobs(SHM_SLOTS);        /* id 0 = no job */
+    auto lastReap = std::chrono::steady_clock::now();
+
+    for (;;) {
+        uint32_t seen = r->reqBell.seq.load(std::memory_order_seq_cst);
+        bool     busy = false;
+
+        for (uint32_t i = 0; i < SHM_SLOTS; ++i) {
+            ShmSlot& s = r->slot[i];
+            RxBuf    buf;
+            ssize_t  got = ringPop(s.req, &buf, sizeof(buf));
+            if (got < 0) continue;
+            busy = true;
+
+            if (static_cast<size_t>(got) == sizeof(calcMessage)) {
+                auto* cm = reinterpret_cast<calcMessage*>(&buf);
+                if (!helloOK(*cm)) {
+                    calcMessage rej = makeVerdict(false);
+                    shmReply(s, &rej, sizeof(rej));
+                    continue;
+                }
+                slotJobs[i]     = makeJob(nextId++);
+                calcProtocol tp = encodeJob(slotJobs[i]);
+                shmReply(s, &tp, sizeof(tp));
+                continue;
+            }
+
+            if (static_cast<size_t>(got) == sizeof(calcProtocol)) {
+                auto* cp = reinterpret_cast<calcProtocol*>(&buf);
+                if (ntohs(cp->type) != 2) continue;   /* not a result */
+
+                Job& job = slotJobs[i];
+                bool ok  = job.id != 0 && job.id == ntohl(cp->id) &&
+                           checkResult(job, *cp);
+                job = Job{};
+
+                calcMessage v = makeVerdict(ok);
+                shmReply(s, &v, sizeof(v));
+            }
+        }
+        /* busy or not: expire jobs and take back slots of vanished clients */
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReap >= std::chrono::seconds(1)) {
+            lastReap = now;
+            for (uint32_t i = 0; i < SHM_SLOTS; ++i) {
+                ShmSlot& s     = r->slot[i];
+                int32_t  owner = s.owner.load(std::memory_order_acquire);
+
+                if (slotJobs[i].id != 0 && slotJobs[i].deadline < now) {
+                    DBG(std::cerr << "shm job in slot " << i << " expired.\n");
+                    slotJobs[i] = Job{};
+                }
+                if (owner != 0 && kill(owner, 0) != 0 && errno == ESRCH) {
+                    DBG(std::cerr << "shm slot " << i << " abandoned by pid "
+                                  << owner << ".\n");
+                    ringDrain(s.req);
+                    slotJobs[i] = Job{};
+                    s.owner.compare_exchange_strong(owner, 0);
+                }
+            }
+        }
+        if (busy) continue;
+
+        timespec ts{1, 0};
+        bellWait(r->reqBell,
+                 [&] { return r->reqBell.seq.load() != seen; },
+                 spins, &ts);
+    }
+}
+
+//kernel-side filtering
+
+/*
+   Socket filter: accept only a 12-byte HELLO of type 22 or a 50-byte
+   RESULT of type 2, so garbage is dropped before it costs a wake-up.
+   UDP runs socket filters with the UDP header at offset 0.
+*/
+static int attachFilter(int sock)
+{
+    constexpr uint32_t UDP_HDR = 8;
+    sock_filter code[] = {
+        BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, UDP_HDR + sizeof(calcMessage), 0, 2),
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, UDP_HDR),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 22, 3, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, UDP_HDR + sizeof(calcProtocol), 0, 3),
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, UDP_HDR),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 2, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    sock_fprog prog{static_cast<unsigned short>(sizeof(code) / sizeof(code[0])),
+                    code};
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+        perror("SO_ATTACH_FILTER");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+   Reuseport steering: the program's return value indexes the group's
+   sockets (bind order), so every server started with -R <n> on the same
+   port picks shard hash(src addr, src port) % n for a given client, and
+   each process only ever sees its own clients' jobs. Reuseport programs
+   run with data at the UDP payload; the headers are reached via
+   SKF_NET_OFF. IPv6 assumes no extension headers.
+*/
+static int attachSteering(int sock, uint32_t shards)
+{
+    sockaddr_storage self{};
+    socklen_t        len = sizeof(self);
+    getsockname(sock, reinterpret_cast<sockaddr*>(&self), &len);
+
+    constexpr uint32_t NET = static_cast<uint32_t>(SKF_NET_OFF);
+    sock_filter v4[] = {
+        BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, NET),
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_IND, NET),        /* sport */
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, NET + 12),   /* saddr */
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shards),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    sock_filter v6[] = {
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, NET + 40),   /* sport */
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, NET + 20),   /* saddr */
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shards),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+
+    sock_fprog prog{};
+    if (self.ss_family == AF_INET6) {
+        prog.len    = sizeof(v6) / sizeof(v6[0]);
+        prog.filter = v6;
+    } else {
+        prog.len    = sizeof(v4) / sizeof(v4[0]);
+        prog.filter = v4;
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(prog))) {
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+        return -1;
+    }
+    return 0;
+}
+
+static void sweepJobs(JobMap& jobs)
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = jobs.begin(); it != jobs.end(); ) {
+        if (it->second.deadline < now) {
+            DBG(std::cerr << "Job for "
+                          << addrToString(it->first.s, it->first.len)
+                          << " expired.\n");
+            it = jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+//warm restart
+
+/*
+   Snapshot of the UDP job table: a header followed by an open-addressed
+   table of fixed-size POD records, keyed by client address with linear
+   probing. A new process maps it and serves straight away: a client the
+   live table does not know is looked up in the mapping and its job moved
+   over (the record is then zeroed in the private mapping), and the whole
+   mapping is dropped once every TTL in it has run out. Nothing is read or
+   rehashed up front, so adopting a table costs the same for any size.
+
+   Each job keeps its remaining TTL rather than its deadline, since a file
+   can outlive a reboot and the monotonic clock with it; time spent down
+   is not charged to the client.
+*/
+static constexpr uint32_t SNAP_MAGIC   = 0x6a6f6273;   /* "jobs" */
+static constexpr uint32_t SNAP_VERSION = 3;
+
+struct SnapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;                 /* records in use */
+    uint64_t slots;                 /* records in the table, > count */
+    uint32_t nextId;
+    uint32_t recSize;
+};
+
+struct SnapJob {
+    uint8_t  addr[sizeof(sockaddr_in6)];
+    uint32_t addrLen;               /* 0 = empty slot */
+    uint32_t id, arith;
+    int32_t  ia, ib, ires;
+    double   fa, fb, fres;
+    int64_t  ttlNs;                 /* <= 0 once taken or expired */
+};
+
+/* An adopted snapshot, mapped private so taken records can be cleared. */
+struct SnapTable {
+    void*                                 map{};
+    size_t                                size{};
+    SnapHeader*                           hdr{};
+    SnapJob*                              rec{};
+    std::chrono::steady_clock::time_point base{};   /* when it was adopted */
+};
+
+static volatile sig_atomic_t stopReq    = 0;
+static volatile sig_atomic_t handoffReq = 0;
+static volatile sig_atomic_t dumpReq    = 0;
+
+static void onSignal(int sig)
+{
+    if (sig == SIGIO)        handoffReq = 1;
+    else if (sig == SIGUSR1) dumpReq    = 1;
+    else                     stopReq    = 1;
+}
+
+/* FNV-1a over the address bytes; must not change within a SNAP_VERSION. */
+static uint64_t snapHash(const void* addr, size_t len)
+{
+    const auto* p = static_cast<const uint8_t*>(addr);
+    uint64_t    h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+/*
+   Slot of <addr> in <rec>: its record, or the empty slot it would go in.
+   nullptr if neither turns up within <slots> probes (corrupt table).
+*/
+static SnapJob* snapSlot(SnapJob* rec, uint64_t slots,
+                         const void* addr, uint32_t len)
+{
+    uint64_t i = snapHash(addr, len) % slots;
+    for (uint64_t n = 0; n < slots; ++n, i = (i + 1 == slots ? 0 : i + 1)) {
+        SnapJob& r = rec[i];
+        if (r.addrLen == 0) return &r;
+        if (r.addrLen == len && std::memcmp(r.addr, addr, len) == 0)
+            return &r;
+    }
+    return nullptr;
+}
+
+/* Remaining TTL of a snapshot record as seen at <now>, capped at JOB_TTL_S. */
+static std::chrono::nanoseconds snapTtl(const SnapTable& t, const SnapJob& r,
+                                        std::chrono::steady_clock::time_point now)
+{
+    return std::min<std::chrono::nanoseconds>(
+               std::chrono::nanoseconds(r.ttlNs),
+               std::chrono::seconds(JOB_TTL_S)) - (now - t.base);
+}
+
+static void snapClose(SnapTable& t)
+{
+    if (t.map) munmap(t.map, t.size);
+    t = SnapTable{};
+}
+
+/*
+   Moves <k>'s job from the first snapshot that still holds it into
+   <jobs>, and clears <k> in all of them so no job is handed out twice.
+   Returns jobs.end() if none holds it, or its TTL has run out.
+*/
+static JobMap::iterator snapTake(std::vector<SnapTable>& snaps, JobMap& jobs,
+                                 const AddrKey& k)
+{
+    if (k.len > sizeof(SnapJob::addr)) return jobs.end();
+    auto now   = std::chrono::steady_clock::now();
+    auto taken = jobs.end();
+
+    for (SnapTable& t : snaps) {
+        SnapJob* r = snapSlot(t.rec, t.hdr->slots, &k.s, k.len);
+        if (!r || r->addrLen == 0 || r->ttlNs <= 0) continue;
+
+        auto ttl = snapTtl(t, *r, now);
+        r->ttlNs = 0;
+        if (taken != jobs.end() || ttl.count() <= 0) continue;
+
+        Job job;
+        job.id       = r->id;
+        job.arith    = r->arith;
+        job.ia       = r->ia;
+        job.ib       = r->ib;
+        job.ires     = r->ires;
+        job.fa       = r->fa;
+        job.fb       = r->fb;
+        job.fres     = r->fres;
+        job.deadline = now + ttl;
+        taken        = jobs.emplace(k, job).first;
+    }
+    return taken;
+}
+
+/* Drops snapshots whose every TTL has run out. */
+static void snapExpire(std::vector<SnapTable>& snaps)
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = snaps.begin(); it != snaps.end(); ) {
+        if (now - it->base >= std::chrono::seconds(JOB_TTL_S)) {
+            DBG(std::cerr << "Snapshot of " << it->hdr->count
+                          << " jobs expired.\n");
+            snapClose(*it);
+            it = snaps.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void snapPut(SnapHeader* hdr, SnapJob* rec, const uint8_t* addr,
+                    uint32_t len, const Job& job, std::chrono::nanoseconds ttl)
+{
+    SnapJob* r = snapSlot(rec, hdr->slots, addr, len);
+    if (!r || r->addrLen != 0) return;          /* first one wins */
+
+    std::memcpy(r->addr, addr, len);
+    r->addrLen = len;
+    r->id      = job.id;
+    r->arith   = job.arith;
+    r->ia      = job.ia;
+    r->ib      = job.ib;
+    r->ires    = job.ires;
+    r->fa      = job.fa;
+    r->fb      = job.fb;
+    r->fres    = job.fres;
+    r->ttlNs   = ttl.count();
+    ++hdr->count;
+}
+
+/*
+   Writes the live table plus whatever adopted snapshots still hold.
+   Returns the number of jobs written, or -1.
+*/
+static long writeSnapshot(int fd, const JobMap& jobs,
+                          const std::vector<SnapTable>& snaps, uint32_t nextId)
+{
+    uint64_t bound = jobs.size();
+    for (const SnapTable& t : snaps) bound += t.hdr->count;
+    uint64_t slots = bound + bound / 2 + 1;     /* load factor <= 2/3 */
+
+    size_t size = sizeof(SnapHeader) + slots * sizeof(SnapJob);
+    if (ftruncate(fd, size) != 0) {
+        perror("ftruncate");
+        return -1;
+    }
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) { perror("mmap"); return -1; }
+
+    auto* hdr  = static_cast<SnapHeader*>(p);
+    auto* rec  = reinterpret_cast<SnapJob*>(hdr + 1);
+    hdr->slots = slots;
+    auto  now  = std::chrono::steady_clock::now();
+
+    for (const auto& [k, job] : jobs) {
+        if (k.len > sizeof(rec->addr)) continue;
+        snapPut(hdr, rec, reinterpret_cast<const uint8_t*>(&k.s), k.len, job,
+                job.deadline - now);
+    }
+    for (const SnapTable& t : snaps) {
+        for (uint64_t i = 0; i < t.hdr->slots; ++i) {
+            const SnapJob& r = t.rec[i];
+            if (r.addrLen == 0 || r.addrLen > sizeof(r.addr) || r.ttlNs <= 0)
+                continue;
+            auto ttl = snapTtl(t, r, now);
+            if (ttl.count() <= 0) continue;
+
+            Job job;
+            job.id    = r.id;
+            job.arith = r.arith;
+            job.ia    = r.ia;
+            job.ib    = r.ib;
+            job.ires  = r.ires;
+            job.fa    = r.fa;
+            job.fb    = r.fb;
+            job.fres  = r.fres;
+            snapPut(hdr, rec, r.addr, r.addrLen, job, ttl);
+        }
+    }
+    long n       = static_cast<long>(hdr->count);
+    hdr->nextId  = nextId;
+    hdr->recSize = sizeof(SnapJob);
+    hdr->version = SNAP_VERSION;
+    hdr->magic   = SNAP_MAGIC;
+    munmap(p, size);
+    return n;
+}
+
+/*
+   Maps the snapshot in <fd> into <t>. Only the header is checked and
+   nothing is read ahead; records fault in as clients come back. Returns
+   the number of jobs it holds, or -1 if <fd> holds no snapshot.
+*/
+static long readSnapshot(int fd, SnapTable& t, std::atomic<uint32_t>& nextId)
+{
+    struct stat st{};
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(SnapHeader))
+        return -1;
+
+    size_t size = st.st_size;
+    void*  p    = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+    if (p == MAP_FAILED) { perror("mmap"); return -1; }
+
+    auto* hdr = static_cast<SnapHeader*>(p);
+    if (hdr->magic != SNAP_MAGIC || hdr->version != SNAP_VERSION ||
+        hdr->recSize != sizeof(SnapJob) || hdr->slots == 0 ||
+        hdr->slots > (size - sizeof(SnapHeader)) / sizeof(SnapJob) ||
+        hdr->count >= hdr->slots) {
+        munmap(p, size);
+        return -1;
+    }
+    madvise(p, size, MADV_RANDOM);          /* probes, not a scan */
+
+    t.map  = p;
+    t.size = size;
+    t.hdr  = hdr;
+    t.rec  = reinterpret_cast<SnapJob*>(hdr + 1);
+    t.base = std::chrono::steady_clock::now();
+    if (hdr->nextId > nextId) nextId = hdr->nextId;
+    return static_cast<long>(hdr->count);
+}
+
+/* Returns the number of jobs saved, or -1. */
+static long saveSnapshot(const std::string& path, const JobMap& jobs,
+                         const std::vector<SnapTable>& snaps, uint32_t nextId)
+{
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd < 0) { perror("open"); return -1; }
+    long n = writeSnapshot(fd, jobs, snaps, nextId);
+    close(fd);
+    if (n >= 0 && rename(tmp.c_str(), path.c_str()) != 0) {
+        perror("rename");
+        n = -1;
+    }
+    return n;
+}
+
+/*
+   Adopts the snapshot at <path>. Returns the number of jobs it holds, -1
+   if there is no file, or -2 if there is one but it is not a snapshot;
+   then it is left alone, since it would be overwritten on exit.
+*/
+static long loadSnapshot(const std::string& path,
+                         std::vector<SnapTable>& snaps,
+                         std::atomic<uint32_t>& nextId)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return -1;
+        perror("open");
+        return -2;
+    }
+    SnapTable t;
+    long n = readSnapshot(fd, t, nextId);
+    close(fd);
+    if (n < 0) return -2;
+
+    snaps.push_back(t);
+    unlink(path.c_str());   /* never adopt the same table twice; map stays */
+    return n;
+}
+
+/* Live table first, then the snapshots; a job taken over joins the budget. */
+static JobMap::iterator findJob(JobMap& jobs, std::vector<SnapTable>& snaps,
+                                JobBudget& b, const AddrKey& k)
+{
+    auto it = jobs.find(k);
+    if (it != jobs.end() || snaps.empty()) return it;
+
+    it = snapTake(snaps, jobs, k);
+    if (it != jobs.end()) budgetAdmit(b, jobs, k, it->second.id);
+    return it;
+}
+
+/*
+   Socket handoff. A running server listens on a unix socket; SIGIO tells
+   it a successor connected. It then stops serving, writes its table into a
+   memfd and passes { UDP socket, memfd } over SCM_RIGHTS. Datagrams that
+   arrive meanwhile simply wait in the shared socket buffer.
+*/
+static int handoffListen(const std::string& path)
+{
+    sockaddr_un sun{};
+    sun.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(sun.sun_path)) {
+        std::cerr << "Handoff path too long.\n";
+        return -1;
+    }
+    std::memcpy(sun.sun_path, path.c_str(), path.size());
+
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ls < 0) { perror("socket"); return -1; }
+    unlink(path.c_str());
+    if (bind(ls, reinterpret_cast<sockaddr*>(&sun), sizeof(sun)) != 0 ||
+        listen(ls, 1) != 0) {
+        perror("handoff bind");
+        close(ls);
+        return -1;
     }
+    fcntl(ls, F_SETOWN, getpid());
+    fcntl(ls, F_SETFL, fcntl(ls, F_GETFL) | O_ASYNC | O_NONBLOCK);
+    return ls;
+}
 
-    /* bind address  */
+/* Returns the number of jobs handed over, or -1. */
+static long handoffGive(int ls, int sock, const JobMap& jobs,
+                        const std::vector<SnapTable>& snaps, uint32_t nextId)
+{
+    int c = accept(ls, nullptr, nullptr);
+    if (c < 0) { perror("accept"); return -1; }
 
-    std::string hp{argv[1]};
+    int mfd = memfd_create("calc-jobs", 0);
+    if (mfd < 0) {
+        perror("memfd_create");
+        close(c);
+        return -1;
+    }
+    long n = writeSnapshot(mfd, jobs, snaps, nextId);
+    if (n < 0) {
+        close(mfd);
+        close(c);
+        return -1;
+    }
+
+    char    tag = 'H';
+    iovec   iov{&tag, 1};
+    alignas(cmsghdr) char ctl[CMSG_SPACE(2 * sizeof(int))]{};
+    msghdr  msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl;
+    msg.msg_controllen = sizeof(ctl);
+
+    cmsghdr* cm  = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(2 * sizeof(int));
+    int fds[2]{sock, mfd};
+    std::memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    if (sendmsg(c, &msg, 0) != 1) {
+        perror("sendmsg");
+        n = -1;
+    }
+    close(mfd);
+    close(c);
+    return n;
+}
+
+/* Returns the predecessor's UDP socket, or -1 if nobody is there. */
+static int handoffTake(const std::string& path, int& snapFd)
+{
+    sockaddr_un sun{};
+    sun.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(sun.sun_path)) return -1;
+    std::memcpy(sun.sun_path, path.c_str(), path.size());
+
+    int c = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c < 0) return -1;
+    if (connect(c, reinterpret_cast<sockaddr*>(&sun), sizeof(sun)) != 0) {
+        close(c);
+        return -1;
+    }
+
+    char    tag = 0;
+    iovec   iov{&tag, 1};
+    alignas(cmsghdr) char ctl[CMSG_SPACE(2 * sizeof(int))]{};
+    msghdr  msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl;
+    msg.msg_controllen = sizeof(ctl);
+
+    ssize_t  got = recvmsg(c, &msg, MSG_CMSG_CLOEXEC);
+    cmsghdr* cm  = CMSG_FIRSTHDR(&msg);
+    close(c);
+    if (got != 1 || tag != 'H' || !cm || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        std::cerr << "Handoff from predecessor failed.\n";
+        return -1;
+    }
+    int fds[2];
+    std::memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    snapFd = fds[1];
+    return fds[0];
+}
+
+//phase accounting
+
+#ifdef PHASES
+/* recv is the recvfrom call alone, including time blocked waiting for
+   traffic, so it is kept out of the busy total the shares are computed
+   against; per-packet logging is charged to log. */
+static void dumpPhases()
+{
+    uint64_t busy = 0;
+    for (int p = PH_RECV + 1; p < PH_COUNT; ++p) busy += phaseCycles[p];
+
+    std::cerr << std::left << std::setw(10) << "phase" << std::right
+              << std::setw(12) << "hits" << std::setw(18) << "cycles"
+              << std::setw(12) << "cyc/hit" << std::setw(8) << "busy%"
+              << '\n';
+    for (int p = 0; p < PH_COUNT; ++p) {
+        uint64_t h = phaseHits[p];
+        std::cerr << std::left << std::setw(10) << phaseName[p] << std::right
+                  << std::setw(12) << h << std::setw(18) << phaseCycles[p]
+                  << std::setw(12) << (h ? phaseCycles[p] / h : 0)
+                  << std::setw(8) << std::fixed << std::setprecision(1);
+        if (p == PH_RECV || busy == 0) std::cerr << "-";
+        else std::cerr << 100.0 * phaseCycles[p] / busy;
+        std::cerr << '\n';
+    }
+}
+#endif
+
+//main
+
+static int bindSocket(const std::string& hp, bool reusePort)
+{
     auto colon = hp.rfind(':');
     if (colon == std::string::npos) {
         std::cerr << "Invalid address format.\n";
-        return 1;
+        return -1;
     }
     std::string host = hp.substr(0, colon);
     std::string port = hp.substr(colon + 1);
@@ -93,13 +999,16 @@ int main(int argc, char* argv[])
 
     if (int rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &res); rv) {
         std::cerr << "getaddrinfo: " << gai_strerror(rv) << '\n';
-        return 1;
+        return -1;
     }
 
     int sock = -1;
     for (addrinfo* p = res; p; p = p->ai_next) {
         sock = socket(p->ai_family, p->ai_socktype, 0);
         if (sock < 0) continue;
+        int one = 1;
+        if (reusePort)
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
         if (bind(sock, p->ai_addr, p->ai_addrlen) == 0) {
             std::cout << "Listening on "
                       << addrToString(
@@ -112,159 +1021,324 @@ int main(int argc, char* argv[])
         sock = -1;
     }
     freeaddrinfo(res);
-    if (sock < 0) { perror("bind"); return 1; }
+    if (sock < 0) perror("bind");
+    return sock;
+}
 
-    /* init and loop  */
+/* Whole-string decimal within [lo, hi] (lo >= 0), or -1. */
+static long parseRange(const char* s, long lo, long hi)
+{
+    char* end = nullptr;
+    errno     = 0;
+    long v    = std::strtol(s, &end, 10);
+    if (errno || end == s || *end || v < lo || v > hi) return -1;
+    return v;
+}
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog
+              << " [-m shm-name] [-p spins] [-s snapshot] [-H handoff-sock]"
+                 " [-f] [-R shards] [-b max-jobs] [-T replay-s]"
+                 " <bind-host:port>\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::string shmName;
+    int         shmSpins = SHM_SPIN;
+    std::string snapPath, handoffPath;
+    bool        filter = false;
+    uint32_t    shards = 0;
+    size_t      maxJobs = 0;
+    int         replayS = HELLO_REPLAY_S;
+
+    for (int opt; (opt = getopt(argc, argv, "m:p:s:H:fR:b:T:")) != -1; ) {
+        switch (opt) {
+            case 'm': shmName     = optarg;            break;
+            case 'p': shmSpins    = std::atoi(optarg); break;
+            case 's': snapPath    = optarg;            break;
+            case 'H': handoffPath = optarg;            break;
+            case 'f': filter      = true;              break;
+            case 'R': {
+                long n = parseRange(optarg, 1, MAX_SHARDS);
+                if (n < 0) {
+                    std::cerr << "Bad shard count '" << optarg
+                              << "', want 1.." << MAX_SHARDS << ".\n";
+                    return 1;
+                }
+                shards = static_cast<uint32_t>(n);
+                break;
+            }
+            case 'b': {
+                long n = parseRange(optarg, 1, MAX_JOBS);
+                if (n < 0) {
+                    std::cerr << "Bad job budget '" << optarg
+                              << "', want 1.." << MAX_JOBS << ".\n";
+                    return 1;
+                }
+                maxJobs = static_cast<size_t>(n);
+                break;
+            }
+            case 'T':
+                replayS = parseRange(optarg, 0, JOB_TTL_S);
+                if (replayS < 0) {
+                    std::cerr << "Bad replay window '" << optarg
+                              << "', want 0.." << JOB_TTL_S << " s.\n";
+                    return 1;
+                }
+                break;
+            default:  usage(argv[0]);                  return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
 
     initCalcLib();
-    uint32_t nextId = 1;
-    JobMap   jobs;
+    std::atomic<uint32_t>  nextId{1};
+    JobMap                 jobs;
+    std::vector<SnapTable> snaps;
+    JobBudget              budget;
+    uint64_t               issued = 0, replayed = 0;
+    if (maxJobs > 0) budgetInit(budget, maxJobs, jobs);
+
+    /* check the snapshot file first: past the handoff there is no way back */
+
+    if (!snapPath.empty()) {
+        long n = loadSnapshot(snapPath, snaps, nextId);
+        if (n == -2) {
+            std::cerr << snapPath << " exists but is not a job snapshot;"
+                         " refusing to overwrite it.\n";
+            return 1;
+        }
+        if (n >= 0) std::cout << "Restored " << n << " jobs from "
+                              << snapPath << '\n';
+    }
+
+    /* adopt the predecessor's socket and jobs, or bind afresh  */
+
+    int sock = -1;
+    if (!handoffPath.empty()) {
+        int snapFd = -1;
+        sock = handoffTake(handoffPath, snapFd);
+        if (sock >= 0) {
+            auto      t0 = std::chrono::steady_clock::now();
+            SnapTable t;
+            long      n  = readSnapshot(snapFd, t, nextId);
+            close(snapFd);
+            if (n >= 0) snaps.push_back(t);
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - t0).count();
+            std::cout << "Took over socket and " << n << " jobs in "
+                      << us << " us\n";
+        }
+    }
+    if (sock < 0) {
+        sock = bindSocket(argv[optind], shards > 0);
+        if (sock < 0) return 1;
+    }
+    if (filter && attachFilter(sock) != 0) return 1;
+    if (shards > 0 && attachSteering(sock, shards) != 0) return 1;
+
+    if (!shmName.empty()) {
+        if (shmName[0] != '/') shmName.insert(0, "/");
+        ShmRegion* region = createShm(shmName);
+        if (!region) return 1;
+        std::cout << "Serving shared memory " << shmName << '\n';
+
+        /* signals below must interrupt recvfrom, not the shm thread */
+        sigset_t mask, old;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGIO);
+        sigaddset(&mask, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &mask, &old);
+        std::thread(serveShm, region, shmSpins, std::ref(nextId)).detach();
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    }
+
+    /* init and loop  */
+
+#ifdef PHASES
+    std::atexit(dumpPhases);
+    {
+        struct sigaction sa{};
+        sa.sa_handler = onSignal;                /* no SA_RESTART */
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, nullptr);
+    }
+#endif
+
+    /*
+       Signal handlers only raise flags, which the loop checks at the top
+       of every pass, busy or not. The receive timeout bounds the window in
+       which a signal can race a recvfrom that is about to block.
+    */
+    {
+        struct sigaction sa{};
+        sa.sa_handler = onSignal;                /* no SA_RESTART */
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGTERM, &sa, nullptr);
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGIO, &sa, nullptr);
+
+        timeval tv{1, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    int handoffFd = -1;
+    if (!handoffPath.empty()) {
+        handoffFd = handoffListen(handoffPath);
+        if (handoffFd < 0) return 1;
+    }
+
+    auto lastSweep = std::chrono::steady_clock::now();
 
     for (;;) {
+#ifdef PHASES
+        if (dumpReq) { dumpReq = 0; dumpPhases(); }
+#endif
+        if (handoffReq) {
+            handoffReq = 0;
+            long n = handoffFd >= 0
+                         ? handoffGive(handoffFd, sock, jobs, snaps, nextId)
+                         : -1;
+            if (n >= 0) {
+                std::cout << "Handed over " << n << " jobs\n";
+                return 0;
+            }
+        }
+        if (stopReq) {
+            std::cout << "Issued " << issued << " jobs, replayed "
+                      << replayed << " HELLOs\n";
+            if (budget.limit)
+                std::cout << "Evicted " << budget.evictions
+                          << " jobs over budget\n";
+            long n = snapPath.empty()
+                         ? -1 : saveSnapshot(snapPath, jobs, snaps, nextId);
+            if (n >= 0)
+                std::cout << "Saved " << n << " jobs to " << snapPath << '\n';
+            return 0;
+        }
+
+        /*
+           Expiry runs on a timer, checked every pass, so neither steady
+           valid traffic nor -f (which keeps malformed datagrams, the old
+           trigger, out of userspace) can postpone it.
+        */
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastSweep >= std::chrono::seconds(SWEEP_S)) {
+            lastSweep = now;
+            PHASE_BEGIN();
+            sweepJobs(jobs);
+            snapExpire(snaps);
+            MARK(PH_SWEEP, sweep, jobs.size());
+        }
+
         sockaddr_storage from{};
         socklen_t        fromLen = sizeof(from);
+        RxBuf            buf;
 
-        std::aligned_storage_t<
-            (sizeof(calcProtocol) > sizeof(calcMessage)
-                 ? sizeof(calcProtocol)
-                 : sizeof(calcMessage)),
-            alignof(calcProtocol)>
-            buf;
-
+        PHASE_BEGIN();
         ssize_t got = recvfrom(sock, &buf, sizeof(buf), 0,
                                reinterpret_cast<sockaddr*>(&from), &fromLen);
-        if (got < 0) { perror("recvfrom"); continue; }
+        if (got < 0) {
+            if (errno != EINTR && errno != EAGAIN) perror("recvfrom");
+            continue;
+        }
+
+        MARK(PH_RECV, receive, got);
 
         std::cout << "RX " << got << " B from "
                   << addrToString(from, fromLen) << '\n';
+        PHASE(PH_LOG);
 
         /* HELLO from client  */
 
         if (static_cast<size_t>(got) == sizeof(calcMessage)) {
-            auto* cm = reinterpret_cast<calcMessage*>(&buf);
-
-            bool versionOK =
-                ntohs(cm->type) == 22 &&
-                ntohl(cm->message) == 0 &&
-                ntohs(cm->major_version) == SUPP_MAJ_VER &&
-                ntohs(cm->minor_version) == SUPP_MIN_VER;
-
-            if (!versionOK) {
-                calcMessage rej{};
-                rej.type          = htons(2);
-                rej.message       = htonl(2);
-                rej.protocol      = htons(17);
-                rej.major_version = htons(SUPP_MAJ_VER);
-                rej.minor_version = htons(SUPP_MIN_VER);
+            auto* cm    = reinterpret_cast<calcMessage*>(&buf);
+            bool  hello = helloOK(*cm);
+            MARK(PH_CLASSIFY, classify, hello ? 1 : 0);
 
+            if (!hello) {
+                calcMessage rej = makeVerdict(false);
                 sendto(sock, &rej, sizeof(rej), 0,
                        reinterpret_cast<sockaddr*>(&from), fromLen);
+                MARK(PH_SEND, send, sizeof(rej));
                 continue;
             }
 
-            /* build new assignment */
-            char* op = randomType();
-            bool  fp = (op[0] == 'f');
+            /*
+               A HELLO from an address whose assignment went out less than
+               replayS (-T, default HELLO_REPLAY_S, at most JOB_TTL_S) ago
+               and has not expired is the client's retransmission: answer
+               with the same job instead of replacing it under the
+               client's feet.
+            */
+            AddrKey k{from, fromLen};
+            auto    now = std::chrono::steady_clock::now();
+            auto    it  = findJob(jobs, snaps, budget, k);
+            MARK(PH_TABLE, table_lookup, it != jobs.end());
 
-            Job job;
-            job.id    = nextId++;
-            job.arith = fp
-                        ? (strcmp(op, "fadd") == 0 ? 5
-                           : strcmp(op, "fsub") == 0 ? 6
-                           : strcmp(op, "fmul") == 0 ? 7
-                                                     : 8)
-                        : (strcmp(op, "add") == 0 ? 1
-                           : strcmp(op, "sub") == 0 ? 2
-                           : strcmp(op, "mul") == 0 ? 3
-                                                    : 4);
-
-            if (fp) {
-                job.fa = randomFloat();
-                job.fb = randomFloat();
-                switch (job.arith) {
-                    case 5: job.fres = job.fa + job.fb; break;
-                    case 6: job.fres = job.fa - job.fb; break;
-                    case 7: job.fres = job.fa * job.fb; break;
-                    case 8: job.fres = job.fa / job.fb; break;
-                }
-            } else {
-                job.ia = randomInt();
-                job.ib = randomInt();
-                switch (job.arith) {
-                    case 1: job.ires = job.ia + job.ib; break;
-                    case 2: job.ires = job.ia - job.ib; break;
-                    case 3: job.ires = job.ia * job.ib; break;
-                    case 4: job.ires = job.ia / job.ib; break;
-                }
+            if (it != jobs.end() && now < it->second.deadline &&
+                now < it->second.deadline - std::chrono::seconds(JOB_TTL_S) +
+                          std::chrono::seconds(replayS)) {
+                DBG(std::cerr << "Replaying job " << it->second.id << " to "
+                              << addrToString(from, fromLen) << '\n');
+                ++replayed;
+                calcProtocol tp = encodeJob(it->second);
+                sendto(sock, &tp, sizeof(tp), 0,
+                       reinterpret_cast<sockaddr*>(&from), fromLen);
+                MARK(PH_SEND, send, sizeof(tp));
+                continue;
             }
-            job.deadline =
-                std::chrono::steady_clock::now() + std::chrono::seconds(JOB_TTL_S);
 
-            AddrKey k{from, fromLen};
-            jobs[k] = job;
-
-            calcProtocol tp{};
-            tp.type          = htons(1);
-            tp.major_version = htons(SUPP_MAJ_VER);
-            tp.minor_version = htons(SUPP_MIN_VER);
-            tp.id            = htonl(job.id);
-            tp.arith         = htonl(job.arith);
-            tp.inValue1      = htonl(job.ia);
-            tp.inValue2      = htonl(job.ib);
-            tp.flValue1      = job.fa;
-            tp.flValue2      = job.fb;
+            /* build new assignment */
+            Job job = makeJob(nextId++);
+            ++issued;
+            MARK(PH_GENERATE, generate, job.id, job.arith);
+            if (it != jobs.end()) it->second = job;
+            else                  jobs.emplace(k, job);
+            budgetAdmit(budget, jobs, k, job.id);
+            MARK(PH_TABLE, table_insert, job.id, jobs.size());
 
+            calcProtocol tp = encodeJob(job);
             sendto(sock, &tp, sizeof(tp), 0,
                    reinterpret_cast<sockaddr*>(&from), fromLen);
+            MARK(PH_SEND, send, sizeof(tp));
             continue;
         }
 
         /* RESULT from client  */
 
         if (static_cast<size_t>(got) == sizeof(calcProtocol)) {
-            auto* cp = reinterpret_cast<calcProtocol*>(&buf);
-            if (ntohs(cp->type) != 2) continue;   /* not a result */
+            auto* cp     = reinterpret_cast<calcProtocol*>(&buf);
+            bool  result = ntohs(cp->type) == 2;
+            MARK(PH_CLASSIFY, classify, result ? 2 : 0);
+            if (!result) continue;                /* not a result */
 
             AddrKey k{from, fromLen};
-            auto    it = jobs.find(k);
+            auto    it = findJob(jobs, snaps, budget, k);
             bool    ok = false;
+            MARK(PH_TABLE, table_lookup, it != jobs.end());
 
             if (it != jobs.end() && it->second.id == ntohl(cp->id)) {
-                Job& job = it->second;
-
-                if (job.arith <= 4) {
-                    ok = static_cast<uint32_t>(job.ires) == ntohl(cp->inResult);
-                } else {
-                    double diff = std::fabs(job.fres - cp->flResult);
-                    ok = diff < 1e-4;
-                }
+                ok = checkResult(it->second, *cp);
+                MARK(PH_VERIFY, verify, it->second.id, ok);
                 jobs.erase(it);
+                MARK(PH_TABLE, table_erase, jobs.size());
             }
 
-            calcMessage v{};
-            v.type          = htons(2);
-            v.message       = htonl(ok ? 1 : 2);
-            v.protocol      = htons(17);
-            v.major_version = htons(SUPP_MAJ_VER);
-            v.minor_version = htons(SUPP_MIN_VER);
-
+            calcMessage v = makeVerdict(ok);
             sendto(sock, &v, sizeof(v), 0,
                    reinterpret_cast<sockaddr*>(&from), fromLen);
+            MARK(PH_SEND, send, sizeof(v));
             continue;
         }
 
-        /* sweep old jobs */
-
-        auto now = std::chrono::steady_clock::now();
-        for (auto it = jobs.begin(); it != jobs.end(); ) {
-            if (it->second.deadline < now) {
-                DBG(std::cerr << "Job for "
-                              << addrToString(it->first.s, it->first.len)
-                              << " expired.\n");
-                it = jobs.erase(it);
-            } else {
-                ++it;
-            }
-        }
+        MARK(PH_CLASSIFY, classify, 0);        /* malformed, ignored */
     }
 }
@@ -0,0 +1,161 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+/*
+   Shared-memory transport for clients running on the same host as the
+   server. The server creates a POSIX shm object holding SHM_SLOTS slots;
+   a client claims one slot (owner = its pid) and then talks to the server
+   through two single-producer/single-consumer rings carrying the exact
+   same calcMessage/calcProtocol records as the UDP path.
+
+   Wake-ups go through futex words living in the region itself (ShmBell).
+   A waiter spins for a while first and only falls back to FUTEX_WAIT if
+   nothing arrived; a producer only issues FUTEX_WAKE when somebody is
+   actually asleep, so a busy session costs no syscalls at all.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* protocol.h has no include guard; include it before this header. */
+
+static constexpr uint32_t SHM_MAGIC = 0x63616c63;   /* "calc" */
+static constexpr uint32_t SHM_SLOTS = 64;
+static constexpr uint32_t SHM_RING  = 4;            /* power of two */
+static constexpr int      SHM_SPIN  = 4096;
+
+struct ShmRecord {
+    uint32_t len;
+    union {
+        calcProtocol  p;
+        calcMessage   m;
+        unsigned char raw[sizeof(calcProtocol) > sizeof(calcMessage)
+                              ? sizeof(calcProtocol)
+                              : sizeof(calcMessage)];
+    };
+};
+
+struct ShmRing {
+    alignas(64) std::atomic<uint32_t> head;   /* written by producer */
+    alignas(64) std::atomic<uint32_t> tail;   /* written by consumer */
+    ShmRecord rec[SHM_RING];
+};
+
+struct ShmBell {
+    alignas(64) std::atomic<uint32_t> seq;    /* futex word */
+    std::atomic<uint32_t> sleeping;
+};
+
+struct ShmSlot {
+    alignas(64) std::atomic<int32_t> owner;   /* client pid, 0 = free */
+    ShmRing req;                              /* client -> server */
+    ShmRing resp;                             /* server -> client */
+    ShmBell respBell;
+};
+
+struct ShmRegion {
+    uint32_t magic;
+    uint32_t size;                            /* sizeof(ShmRegion) of creator */
+    uint32_t nslots;
+    ShmBell  reqBell;                         /* any slot -> server */
+    ShmSlot  slot[SHM_SLOTS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "shared-memory rings need lock-free 32-bit atomics");
+
+//ring ops
+
+inline bool ringEmpty(const ShmRing& r)
+{
+    return r.head.load(std::memory_order_acquire) ==
+           r.tail.load(std::memory_order_relaxed);
+}
+
+inline bool ringPush(ShmRing& r, const void* buf, size_t len)
+{
+    uint32_t h = r.head.load(std::memory_order_relaxed);
+    if (h - r.tail.load(std::memory_order_acquire) == SHM_RING) return false;
+    if (len > sizeof(r.rec[0].raw)) return false;
+
+    ShmRecord& rec = r.rec[h & (SHM_RING - 1)];
+    rec.len = static_cast<uint32_t>(len);
+    std::memcpy(rec.raw, buf, len);
+    r.head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+/* Same truncation semantics as recv() on a datagram socket. */
+inline ssize_t ringPop(ShmRing& r, void* buf, size_t cap)
+{
+    uint32_t t = r.tail.load(std::memory_order_relaxed);
+    if (r.head.load(std::memory_order_acquire) == t) return -1;
+
+    const ShmRecord& rec = r.rec[t & (SHM_RING - 1)];
+    size_t n = rec.len < cap ? rec.len : cap;
+    std::memcpy(buf, rec.raw, n);
+    r.tail.store(t + 1, std::memory_order_release);
+    return static_cast<ssize_t>(n);
+}
+
+/* Consumer side only: throw away anything still queued. */
+inline void ringDrain(ShmRing& r)
+{
+    r.tail.store(r.head.load(std::memory_order_acquire),
+                 std::memory_order_release);
+}
+
+//wake-ups
+
+inline long futexOp(std::atomic<uint32_t>* w, int op, uint32_t val,
+                    const timespec* ts)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(w), op, val, ts,
+                   nullptr, 0);
+}
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+inline void bellRing(ShmBell& b)
+{
+    b.seq.fetch_add(1, std::memory_order_seq_cst);
+    if (b.sleeping.load(std::memory_order_seq_cst))
+        futexOp(&b.seq, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+/*
+   Wait until ready() holds, spinning <spins> rounds before sleeping.
+   Returns ready() as observed last; may return false early on a spurious
+   wake-up or when <ts> (relative, nullptr = forever) runs out.
+*/
+template <class Pred>
+inline bool bellWait(ShmBell& b, Pred ready, int spins, const timespec* ts)
+{
+    for (int i = 0; i < spins; ++i) {
+        if (ready()) return true;
+        cpuRelax();
+    }
+
+    b.sleeping.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t s  = b.seq.load(std::memory_order_seq_cst);
+    bool     ok = ready();
+    if (!ok) {
+        futexOp(&b.seq, FUTEX_WAIT, s, ts);
+        ok = ready();
+    }
+    b.sleeping.fetch_sub(1, std::memory_order_seq_cst);
+    return ok;
+}
+
+#endif